@@ -0,0 +1,142 @@
+#include "xwin.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+// Takes items of the current job until there are none left, called with p_lock held
+static void s_xwin_pool_drain(struct xwin_pool *p, struct xwin_font_ctx *f) {
+    while (p->p_next < p->p_items) {
+        int item = p->p_next++;
+        pthread_mutex_unlock(&p->p_lock);
+        p->p_fn(f, p->p_arg, item);
+        pthread_mutex_lock(&p->p_lock);
+    }
+}
+
+static void *s_xwin_worker_main(void *arg) {
+    struct xwin_worker *k = arg;
+    struct xwin_pool *p = k->k_pool;
+
+    pthread_mutex_lock(&p->p_lock);
+    for (;;) {
+        while (!p->p_slots && !p->p_quit) {
+            pthread_cond_wait(&p->p_start, &p->p_lock);
+        }
+        if (p->p_quit) {
+            break;
+        }
+        --p->p_slots;
+
+        s_xwin_pool_drain(p, &k->k_font);
+
+        if (!--p->p_running) {
+            pthread_cond_signal(&p->p_done);
+        }
+    }
+    pthread_mutex_unlock(&p->p_lock);
+
+    return NULL;
+}
+
+int xwin_pool_create(struct xwin_pool *p, int count, double char_width) {
+    if (count <= 0) {
+        // The calling thread takes a share of every job
+        count = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+        if (count > CT_MAX_WORKERS) {
+            count = CT_MAX_WORKERS;
+        }
+    }
+
+    p->p_workers = NULL;
+    p->p_count = 0;
+    p->p_slots = 0;
+    p->p_running = 0;
+    p->p_quit = 0;
+
+    if (count <= 0) {
+        // Single CPU, the caller paints alone
+        return 0;
+    }
+
+    if (!(p->p_workers = calloc(sizeof(struct xwin_worker), count))) {
+        return -1;
+    }
+
+    pthread_mutex_init(&p->p_lock, NULL);
+    pthread_cond_init(&p->p_start, NULL);
+    pthread_cond_init(&p->p_done, NULL);
+
+    for (int i = 0; i < count; ++i) {
+        struct xwin_worker *k = &p->p_workers[p->p_count];
+
+        // FreeType faces and HarfBuzz buffers are not thread safe, each worker owns a set
+        if (xwin_font_ctx_create(&k->k_font) != 0) {
+            break;
+        }
+        k->k_font.f_char_width = char_width;
+        k->k_pool = p;
+
+        if (pthread_create(&k->k_thread, NULL, s_xwin_worker_main, k) != 0) {
+            xwin_font_ctx_destroy(&k->k_font);
+            break;
+        }
+        ++p->p_count;
+    }
+
+    return p->p_count == count ? 0 : -1;
+}
+
+void xwin_pool_destroy(struct xwin_pool *p) {
+    if (!p->p_workers) {
+        return;
+    }
+
+    pthread_mutex_lock(&p->p_lock);
+    p->p_quit = 1;
+    pthread_cond_broadcast(&p->p_start);
+    pthread_mutex_unlock(&p->p_lock);
+
+    for (int i = 0; i < p->p_count; ++i) {
+        pthread_join(p->p_workers[i].k_thread, NULL);
+        xwin_font_ctx_destroy(&p->p_workers[i].k_font);
+    }
+
+    pthread_cond_destroy(&p->p_done);
+    pthread_cond_destroy(&p->p_start);
+    pthread_mutex_destroy(&p->p_lock);
+
+    free(p->p_workers);
+    p->p_workers = NULL;
+    p->p_count = 0;
+}
+
+// Runs fn for every item in [0, items). The caller works on items too, using
+// its own font context f, and only as many workers as there are items left are woken.
+void xwin_pool_run(struct xwin_pool *p, struct xwin_font_ctx *f, void (*fn)(struct xwin_font_ctx *, void *, int), void *arg, int items) {
+    int helpers = items - 1 < p->p_count ? items - 1 : p->p_count;
+
+    if (helpers < 0) {
+        helpers = 0;
+    }
+
+    pthread_mutex_lock(&p->p_lock);
+    p->p_fn = fn;
+    p->p_arg = arg;
+    p->p_items = items;
+    p->p_next = 0;
+    p->p_slots = helpers;
+    p->p_running = helpers;
+    for (int i = 0; i < helpers; ++i) {
+        pthread_cond_signal(&p->p_start);
+    }
+
+    s_xwin_pool_drain(p, f);
+
+    // Workers that did not wake up in time are no longer needed
+    p->p_running -= p->p_slots;
+    p->p_slots = 0;
+
+    while (p->p_running) {
+        pthread_cond_wait(&p->p_done, &p->p_lock);
+    }
+    pthread_mutex_unlock(&p->p_lock);
+}
@@ -0,0 +1,103 @@
+#include "xwin.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline int s_min(int a, int b) {
+    return a < b ? a : b;
+}
+
+static inline int s_max(int a, int b) {
+    return a > b ? a : b;
+}
+
+void xwin_raster_fill(const struct xwin_raster *r, int x, int y, int width, int height, int gray) {
+    int x0 = s_max(x, r->r_x0), x1 = s_min(x + width, r->r_x1);
+    int y0 = s_max(y, r->r_y0), y1 = s_min(y + height, r->r_y1);
+    uint32_t pixel = gray * 0x010101u;
+
+    for (int py = y0; py < y1; ++py) {
+        uint32_t *dst = r->r_data + py * r->r_stride;
+        for (int px = x0; px < x1; ++px) {
+            dst[px] = pixel;
+        }
+    }
+}
+
+// Blends a coverage bitmap with its top-left corner at (x, y) in the given gray level
+void xwin_raster_glyph(const struct xwin_raster *r, const struct xwin_glyph *g, int x, int y, int gray) {
+    int x0 = s_max(x, r->r_x0), x1 = s_min(x + g->g_width, r->r_x1);
+    int y0 = s_max(y, r->r_y0), y1 = s_min(y + g->g_rows, r->r_y1);
+
+    for (int py = y0; py < y1; ++py) {
+        const unsigned char *src = g->g_bits + (py - y) * g->g_width - x;
+        uint32_t *dst = r->r_data + py * r->r_stride;
+
+        for (int px = x0; px < x1; ++px) {
+            unsigned a = src[px];
+            if (!a) {
+                continue;
+            }
+
+            uint32_t d = dst[px], o = 0;
+            for (int shift = 0; shift < 24; shift += 8) {
+                int dc = (d >> shift) & 0xFF;
+                dc += ((gray - dc) * (int) a + 127) / 255;
+                o |= (uint32_t) dc << shift;
+            }
+            dst[px] = o;
+        }
+    }
+}
+
+// Returns the rendered bitmap of glyph gid from the context's cache, NULL if it has no coverage bitmap
+const struct xwin_glyph *xwin_font_ctx_glyph(struct xwin_font_ctx *f, unsigned int gid) {
+    struct xwin_glyph *g = &f->f_glyphs[gid % CT_GLYPH_CACHE];
+
+    if (g->g_valid && g->g_id == gid) {
+        return g->g_bits ? g : NULL;
+    }
+
+    free(g->g_bits);
+    memset(g, 0, sizeof(*g));
+
+    if (FT_Load_Glyph(f->f_ft_face, gid, FT_LOAD_RENDER)) {
+        return NULL;
+    }
+
+    const FT_GlyphSlot slot = f->f_ft_face->glyph;
+    const FT_Bitmap *b = &slot->bitmap;
+
+    g->g_id = gid;
+    g->g_valid = 1;
+
+    if (!b->width || !b->rows
+     || (b->pixel_mode != FT_PIXEL_MODE_GRAY && b->pixel_mode != FT_PIXEL_MODE_MONO)) {
+        return NULL;
+    }
+
+    if (!(g->g_bits = malloc(b->width * b->rows))) {
+        g->g_valid = 0;
+        return NULL;
+    }
+
+    g->g_width = b->width;
+    g->g_rows = b->rows;
+    g->g_left = slot->bitmap_left;
+    g->g_top = slot->bitmap_top;
+
+    for (int row = 0; row < g->g_rows; ++row) {
+        const unsigned char *src = b->pitch >= 0 ? b->buffer + row * b->pitch
+                                                 : b->buffer + (g->g_rows - 1 - row) * -b->pitch;
+        unsigned char *dst = g->g_bits + row * g->g_width;
+
+        if (b->pixel_mode == FT_PIXEL_MODE_GRAY) {
+            memcpy(dst, src, g->g_width);
+        } else {
+            for (int col = 0; col < g->g_width; ++col) {
+                dst[col] = src[col >> 3] & (0x80 >> (col & 7)) ? 0xFF : 0;
+            }
+        }
+    }
+
+    return g;
+}
@@ -23,6 +23,7 @@ int xwin_tbuf_create(struct xwin_tbuf *t, int rows, int cols) {
     t->t_lines = calloc(sizeof(wchar_t *), rows);
     t->t_dirty = calloc(sizeof(int), rows);
     t->t_vis_attrs = calloc(sizeof(int *), rows);
+    t->t_comb = calloc(sizeof(*t->t_comb), rows);
     t->t_cx = 0;
     t->t_cy = 0;
 
@@ -36,18 +37,22 @@ int xwin_tbuf_create(struct xwin_tbuf *t, int rows, int cols) {
 void xwin_tbuf_scrollup(struct xwin_tbuf *t) {
     wchar_t * line0 = t->t_lines[0];
     int *vis0 = t->t_vis_attrs[0];
+    void *comb0 = t->t_comb[0];
 
     for (int i = 0; i < t->t_rows - 1; ++i) {
         t->t_lines[i] = t->t_lines[i + 1];
         t->t_vis_attrs[i] = t->t_vis_attrs[i + 1];
+        t->t_comb[i] = t->t_comb[i + 1];
     }
     t->t_lines[t->t_rows - 1] = NULL;
     t->t_vis_attrs[t->t_rows - 1] = NULL;
+    t->t_comb[t->t_rows - 1] = NULL;
 
     xwin_tbuf_dirty_all(t);
 
     free(line0);
     free(vis0);
+    free(comb0);
 }
 
 void xwin_tbuf_move(struct xwin_tbuf *t, int y, int x) {
@@ -61,10 +66,29 @@ static inline void xwin_tbuf_set(struct xwin_tbuf *t, int y, int x, wchar_t c, i
         t->t_lines[y] = malloc((t->t_cols + 1) * sizeof(wchar_t));
         t->t_vis_attrs[y] = malloc(sizeof(int) * t->t_cols);
         // Pad with spaces
-        memset(t->t_lines[y], ' ', x * sizeof(wchar_t));
-        memset(t->t_lines[y] + x + 1, 0, (t->t_cols - x) * sizeof(wchar_t));
-        memset(t->t_vis_attrs[y], 0, t->t_cols * sizeof(int));
+        wmemset(t->t_lines[y], ' ', x);
         // Zero-terminate
+        wmemset(t->t_lines[y] + x + 1, 0, t->t_cols - x);
+        memset(t->t_vis_attrs[y], 0, t->t_cols * sizeof(int));
+    } else {
+        wchar_t *line = t->t_lines[y];
+        // Overwriting either half of a wide character blanks the other one
+        if (c != CT_WIDE_CONT && line[x] == CT_WIDE_CONT && x) {
+            line[x - 1] = ' ';
+            if (t->t_comb[y]) {
+                t->t_comb[y][x - 1][0] = 0;
+            }
+        }
+        if (line[x + 1] == CT_WIDE_CONT) {
+            line[x + 1] = ' ';
+            if (t->t_comb[y]) {
+                t->t_comb[y][x + 1][0] = 0;
+            }
+        }
+    }
+
+    if (t->t_comb[y]) {
+        t->t_comb[y][x][0] = 0;
     }
 
     t->t_vis_attrs[y][x] = attr;
@@ -72,9 +96,54 @@ static inline void xwin_tbuf_set(struct xwin_tbuf *t, int y, int x, wchar_t c, i
     t->t_dirty[y] = 1;
 }
 
+// Zero width characters are stored with the cell preceding the cursor
+static void xwin_tbuf_attach(struct xwin_tbuf *t, wchar_t c) {
+    int y = t->t_cy;
+    int x = t->t_cx - 1;
+
+    if (x < 0 || y >= t->t_rows || !t->t_lines[y]) {
+        // No base character, drop it
+        return;
+    }
+
+    if (t->t_lines[y][x] == CT_WIDE_CONT) {
+        --x;
+    }
+
+    if (!t->t_comb[y] && !(t->t_comb[y] = calloc(t->t_cols, sizeof(*t->t_comb[y])))) {
+        return;
+    }
+
+    for (int i = 0; i < CT_MAX_COMBINING; ++i) {
+        if (!t->t_comb[y][x][i]) {
+            t->t_comb[y][x][i] = c;
+            if (i + 1 < CT_MAX_COMBINING) {
+                t->t_comb[y][x][i + 1] = 0;
+            }
+            t->t_dirty[y] = 1;
+            return;
+        }
+    }
+}
+
 void xwin_tbuf_putc(struct xwin_tbuf *t, wchar_t c, int attr) {
-    if (c > '\n') {
-        if (t->t_cx == t->t_cols - 2) {
+    unsigned p = xuprop(c);
+
+    // Surrogates, noncharacters and out of range values, including CT_WIDE_CONT
+    if (XU_CLASS(p) == XU_CLASS_INVALID) {
+        c = 0xFFFD;
+        p = xuprop(c);
+    }
+
+    if (XU_CLASS(p) != XU_CLASS_CTRL) {
+        int cw = XU_WIDTH(p);
+
+        if (!cw) {
+            xwin_tbuf_attach(t, c);
+            return;
+        }
+
+        if (t->t_cx + cw > t->t_cols - 2) {
             t->t_cx = 0;
             ++t->t_cy;
         }
@@ -85,8 +154,11 @@ void xwin_tbuf_putc(struct xwin_tbuf *t, wchar_t c, int attr) {
         }
 
         xwin_tbuf_set(t, t->t_cy, t->t_cx, c, attr);
+        if (cw == 2) {
+            xwin_tbuf_set(t, t->t_cy, t->t_cx + 1, CT_WIDE_CONT, attr);
+        }
 
-        t->t_cx++;
+        t->t_cx += cw;
     } else {
         switch (c) {
         case '\n':          // Line feed
@@ -120,6 +192,10 @@ void xwin_tbuf_putc(struct xwin_tbuf *t, wchar_t c, int attr) {
                         --t->t_cx;
                         /*t->t_lines[t->t_cy][--t->t_cx] = 0;*/
                     }
+                    // Step over both halves of a wide character
+                    if (t->t_cx && t->t_lines[t->t_cy][t->t_cx] == CT_WIDE_CONT) {
+                        --t->t_cx;
+                    }
                     t->t_dirty[t->t_cy] = 1;
                 }
             } else {
@@ -144,9 +220,11 @@ int xwin_tbuf_resize(struct xwin_tbuf *t, int r, int c) {
     t->t_lines = realloc(t->t_lines, sizeof(char *) * r);
     t->t_vis_attrs = realloc(t->t_vis_attrs, sizeof(int *) * r);
     t->t_dirty = realloc(t->t_dirty, sizeof(int) * r);
+    t->t_comb = realloc(t->t_comb, sizeof(*t->t_comb) * r);
     for (int i = t->t_rows; i < r; ++i) {
         t->t_lines[i] = NULL;
         t->t_vis_attrs[i] = NULL;
+        t->t_comb[i] = NULL;
         t->t_dirty[i] = 0;
     }
     t->t_rows = r;
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <wchar.h>
+
+// Character classes, must match tools/gen_uwidth.py
+#define XU_CLASS_CTRL       0
+#define XU_CLASS_PRINT      1
+#define XU_CLASS_WIDE       2
+#define XU_CLASS_COMBINING  3
+#define XU_CLASS_ZERO       4
+#define XU_CLASS_INVALID    5
+
+#define XU_SHIFT            8
+#define XU_MAX              0x10FFFF
+
+// Packed property: display width in the low two bits, class above them
+#define XU_WIDTH(p)         ((p) & 3)
+#define XU_CLASS(p)         ((p) >> 2)
+
+// Generated at build time into src/uwidth_tab.c
+extern const uint16_t xu_stage1[];
+extern const uint8_t  xu_stage2[];
+
+static inline unsigned xuprop(wchar_t c) {
+    if ((uint32_t) c > XU_MAX) {
+        return (XU_CLASS_INVALID << 2) | 1;
+    }
+    return xu_stage2[(xu_stage1[(uint32_t) c >> XU_SHIFT] << XU_SHIFT) | (c & ((1 << XU_SHIFT) - 1))];
+}
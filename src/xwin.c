@@ -1,6 +1,7 @@
 #include "xwin.h"
 #include <cairo/cairo-ft.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <assert.h>
 #include <hb-ft.h>
 #include <stdlib.h>
@@ -65,6 +66,11 @@ int xwin_font_ctx_create(struct xwin_font_ctx *f) {
         return -1;
     }
 
+    if (!(f->f_glyphs = calloc(CT_GLYPH_CACHE, sizeof(struct xwin_glyph)))) {
+        fprintf(stderr, "Failed to allocate glyph cache\n");
+        return -1;
+    }
+
     assert(FT_IS_FIXED_WIDTH(f->f_ft_face));
 
 
@@ -72,6 +78,11 @@ int xwin_font_ctx_create(struct xwin_font_ctx *f) {
 }
 
 void xwin_font_ctx_destroy(struct xwin_font_ctx *f) {
+    for (int i = 0; f->f_glyphs && i < CT_GLYPH_CACHE; ++i) {
+        free(f->f_glyphs[i].g_bits);
+    }
+    free(f->f_glyphs);
+
     hb_buffer_destroy(f->f_hb_buffer);
     hb_font_destroy(f->f_hb_font);
 
@@ -155,6 +166,7 @@ int xwin_create(struct xwin *w, const char *title, int width, int height) {
     const uint32_t window_hints[] = {
         w->w_screen->black_pixel,
         XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE
+      | XCB_EVENT_MASK_VISIBILITY_CHANGE | XCB_EVENT_MASK_FOCUS_CHANGE
     };
 
     xcb_create_window(w->w_conn,
@@ -171,6 +183,20 @@ int xwin_create(struct xwin *w, const char *title, int width, int height) {
                       window_hint_mask,
                       window_hints);
 
+    // Ask the WM to send a message on close instead of killing the connection
+    w->w_wm_protocols = XInternAtom(w->w_xdisplay, "WM_PROTOCOLS", False);
+    w->w_wm_delete = XInternAtom(w->w_xdisplay, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(w->w_xdisplay, w->w_id, &w->w_wm_delete, 1);
+
+    w->w_mapped = 0;
+    w->w_visibility = VisibilityUnobscured;
+    w->w_focused = 0;
+    w->w_visible = 0;
+
+    w->w_cursor.c_drawn = 0;
+    w->w_cursor.c_ndamage = 0;
+    xwin_cursor_style(w, CT_CURSOR, CT_CURSOR_BLINK);
+
     xcb_map_window(w->w_conn, w->w_id);
 
     if (xwin_input_ctx_create(&w->w_input, w) != 0) {
@@ -192,132 +218,438 @@ int xwin_create(struct xwin *w, const char *title, int width, int height) {
 
     w->w_font.f_char_width = text_extents.width;
 
+    w->w_graph.g_back = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+
+    // Render workers start on the first large redraw
+    w->w_pool.p_workers = NULL;
+    w->w_pool.p_count = 0;
+    w->w_pool_started = 0;
+
     w->w_closed = 0;
 
     return 0;
 }
 
 void xwin_destroy(struct xwin *w) {
+    xwin_pool_destroy(&w->w_pool);
+    cairo_surface_destroy(w->w_graph.g_back);
+
     xcb_disconnect(w->w_conn);
 
     xwin_font_ctx_destroy(&w->w_font);
 }
 
-static void s_xwin_draw_text(struct xwin *w, cairo_t *cr, double x, double y, int j, cairo_glyph_t *cairo_glyphs) {
-    struct xwin_font_ctx *f = &w->w_font;
-
+// Shapes columns [c0, c1) of row j into f->f_hb_buffer
+static void s_xwin_shape(struct xwin *w, struct xwin_font_ctx *f, int j, int c0, int c1) {
     const wchar_t *text = w->w_tbuf.t_lines[j];
+    wchar_t (*comb)[CT_MAX_COMBINING] = w->w_tbuf.t_comb[j];
     size_t in_len = xwstrlen(text);
 
+    if ((size_t) c1 > in_len) {
+        c1 = in_len;
+    }
+
     hb_buffer_reset(f->f_hb_buffer);
-    hb_buffer_add_utf32(f->f_hb_buffer, text, -1, 0, -1);
+    hb_buffer_set_content_type(f->f_hb_buffer, HB_BUFFER_CONTENT_TYPE_UNICODE);
+    // Cluster values are cell columns, so glyphs map back onto the grid
+    for (int c = c0; c < c1; ++c) {
+        if (text[c] == CT_WIDE_CONT) {
+            continue;
+        }
+        hb_buffer_add(f->f_hb_buffer, text[c], c);
+        for (int k = 0; comb && k < CT_MAX_COMBINING && comb[c][k]; ++k) {
+            hb_buffer_add(f->f_hb_buffer, comb[c][k], c);
+        }
+    }
     hb_buffer_set_direction(f->f_hb_buffer, HB_DIRECTION_LTR);
     hb_buffer_set_script(f->f_hb_buffer, HB_SCRIPT_LATIN);
 
     hb_shape(f->f_hb_font, f->f_hb_buffer, NULL, 0);
+}
 
-    int len = hb_buffer_get_length(f->f_hb_buffer);
+// Left edge of column j in pixels
+static inline int s_xwin_cell_x(const struct xwin_font_ctx *f, int j) {
+    return CT_PAD_X + (int) (j * f->f_char_width + 0.5);
+}
+
+// Shapes and rasterizes columns [c0, c1) of row j with baseline y, inv swaps the colours
+static void s_xwin_draw_text(struct xwin *w, struct xwin_font_ctx *f, const struct xwin_raster *r, int y, int j, int c0, int c1, int inv) {
+    const wchar_t *text = w->w_tbuf.t_lines[j];
+    wchar_t (*comb)[CT_MAX_COMBINING] = w->w_tbuf.t_comb[j];
+
+    s_xwin_shape(w, f, j, c0, c1);
+
+    unsigned int len;
     const hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(f->f_hb_buffer, &len);
+    const hb_glyph_position_t *glyph_pos = hb_buffer_get_glyph_positions(f->f_hb_buffer, &len);
+
+    // Pen offset inside the current cell, marks are placed relative to it
+    int cluster = -1;
+    double pen = 0;
 
-    assert(len == in_len);
+    for (unsigned int i = 0; i < len; ++i) {
+        int col = glyph_info[i].cluster;
+        if (col != cluster) {
+            cluster = col;
+            pen = 0;
+        }
+
+        double gx = s_xwin_cell_x(f, col) + pen + glyph_pos[i].x_offset / 64.0;
+        double gy = y - glyph_pos[i].y_offset / 64.0;
+        pen += glyph_pos[i].x_advance / 64.0;
 
-    for (int i = 0; i < len; ++i) {
-        if (text[i] == ' ') {
+        if (text[col] == ' ' && !(comb && comb[col][0])) {
             continue;
         }
 
-        int attr = 0xFF - w->w_tbuf.t_vis_attrs[j][i] & 0xFF;
-        if (w->w_tbuf.t_cx == i && w->w_tbuf.t_cy == j) {
-            int o = attr & 0xFF;
-            attr &= ~0xFF;
-            attr |= 0xFF - o;
+        // Rendered by this thread's own FT_Face, no lock shared with other workers
+        const struct xwin_glyph *g = xwin_font_ctx_glyph(f, glyph_info[i].codepoint);
+        if (!g) {
+            continue;
         }
 
-        cairo_set_source_rgb(cr, attr / 255.0, attr / 255.0, attr / 255.0);
+        int attr = 0xFF - w->w_tbuf.t_vis_attrs[j][col] & 0xFF;
+        if (inv) {
+            attr = 0xFF - attr;
+        }
+
+        xwin_raster_glyph(r, g, (int) (gx + 0.5) + g->g_left, (int) (gy + 0.5) - g->g_top, attr);
+    }
+}
+
+// Fills the backgrounds of columns [c0, c1) of row i and draws their text, clipped to r
+static void s_xwin_draw_cells(struct xwin *w, struct xwin_font_ctx *f, const struct xwin_raster *r, int i, int c0, int c1, int inv) {
+    const struct xwin_tbuf *t = &w->w_tbuf;
 
-        hb_codepoint_t gid = glyph_info[i].codepoint;
-        cairo_glyphs[i].index = gid;
-        cairo_glyphs[i].x = x + i * f->f_char_width;
-        cairo_glyphs[i].y = y;
+    for (int j = c0; j < c1; ++j) {
+        int attr = t->t_lines[i] ? t->t_vis_attrs[i][j] & 0xFF : 0;
 
-        cairo_show_glyphs(cr, &cairo_glyphs[i], 1);
+        if (inv) {
+            attr = 0xFF - attr;
+        }
+
+        xwin_raster_fill(r, s_xwin_cell_x(f, j), CT_PAD_Y + i * CT_FONT_SIZE, s_xwin_cell_x(f, j + 1) - s_xwin_cell_x(f, j), CT_FONT_SIZE, attr);
+    }
+
+    if (t->t_lines[i]) {
+        s_xwin_draw_text(w, f, r, CT_PAD_Y + i * CT_FONT_SIZE + CT_FONT_SIZE, i, c0, c1, inv);
     }
 }
 
-static void s_xwin_paint(struct xwin *w, cairo_t *cr) {
-    if (!w->w_width_chars || !w->w_height_chars) {
+// Restricts r to the pixels of row i, or of cells [c0, c1) of it
+static struct xwin_raster s_xwin_clip(struct xwin *w, const struct xwin_raster *r, int i, int c0, int c1) {
+    struct xwin_raster o = *r;
+    int y0 = CT_PAD_Y + i * CT_FONT_SIZE;
+
+    if (y0 > o.r_y0) {
+        o.r_y0 = y0;
+    }
+    if (y0 + CT_FONT_SIZE < o.r_y1) {
+        o.r_y1 = y0 + CT_FONT_SIZE;
+    }
+    if (c1 > c0) {
+        if (s_xwin_cell_x(&w->w_font, c0) > o.r_x0) {
+            o.r_x0 = s_xwin_cell_x(&w->w_font, c0);
+        }
+        if (s_xwin_cell_x(&w->w_font, c1) < o.r_x1) {
+            o.r_x1 = s_xwin_cell_x(&w->w_font, c1);
+        }
+    }
+    return o;
+}
+
+// Moves *j to the first cell of the cluster it belongs to (the lead cell of a wide
+// character, the start of a ligature) and returns the cluster width in cells
+static int s_xwin_cell_span(struct xwin *w, int i, int *j) {
+    const wchar_t *line = w->w_tbuf.t_lines[i];
+    int in_len = line ? xwstrlen(line) : 0;
+
+    if (*j >= in_len) {
+        return 1;
+    }
+
+    s_xwin_shape(w, &w->w_font, i, 0, in_len);
+
+    unsigned int len;
+    const hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(w->w_font.f_hb_buffer, &len);
+    int c0 = 0, c1 = in_len;
+
+    // Clusters are in increasing column order for LTR text
+    for (unsigned int k = 0; k < len; ++k) {
+        int col = glyph_info[k].cluster;
+        if (col <= *j) {
+            c0 = col;
+        } else {
+            c1 = col;
+            break;
+        }
+    }
+
+    *j = c0;
+    return c1 - c0;
+}
+
+static void s_xwin_cell_rect(struct xwin *w, cairo_t *cr, int i, int j, int n) {
+    cairo_rectangle(cr, s_xwin_cell_x(&w->w_font, j), CT_PAD_Y + i * CT_FONT_SIZE,
+                    s_xwin_cell_x(&w->w_font, j + n) - s_xwin_cell_x(&w->w_font, j), CT_FONT_SIZE);
+}
+
+// Repaints the n cells of the cluster starting at column j, clipped to them
+static void s_xwin_paint_cell(struct xwin *w, const struct xwin_raster *r, int i, int j, int n, int inv) {
+    struct xwin_raster cell = s_xwin_clip(w, r, i, j, j + n);
+
+    s_xwin_draw_cells(w, &w->w_font, &cell, i, j, j + n, inv);
+}
+
+static void s_xwin_paint_cursor(struct xwin *w, const struct xwin_raster *r) {
+    const struct xwin_font_ctx *f = &w->w_font;
+    struct xwin_cursor *c = &w->w_cursor;
+    int i = c->c_y, j = c->c_x;
+    int n = s_xwin_cell_span(w, i, &j);
+    int x = s_xwin_cell_x(f, j);
+    int y = CT_PAD_Y + i * CT_FONT_SIZE;
+    int width = s_xwin_cell_x(f, j + n) - x;
+
+    if (c->c_shape == CT_CURSOR_BLOCK && w->w_focused) {
+        s_xwin_paint_cell(w, r, i, j, n, 1);
+        return;
+    }
+
+    int attr = w->w_tbuf.t_lines[i] ? w->w_tbuf.t_vis_attrs[i][j] & 0xFF : 0;
+    attr = 0xFF - attr;
+
+    if (!w->w_focused) {
+        // Hollow block while unfocused
+        xwin_raster_fill(r, x, y, width, 1, attr);
+        xwin_raster_fill(r, x, y + CT_FONT_SIZE - 1, width, 1, attr);
+        xwin_raster_fill(r, x, y, 1, CT_FONT_SIZE, attr);
+        xwin_raster_fill(r, x + width - 1, y, 1, CT_FONT_SIZE, attr);
+    } else if (c->c_shape == CT_CURSOR_UNDERLINE) {
+        xwin_raster_fill(r, x, y + CT_FONT_SIZE - CT_CURSOR_THICKNESS, width, CT_CURSOR_THICKNESS, attr);
+    } else {
+        xwin_raster_fill(r, x, y, CT_CURSOR_THICKNESS, CT_FONT_SIZE, attr);
+    }
+}
+
+// Records the cell the cursor was last drawn at and the cell it belongs at
+static void s_xwin_cursor_damage(struct xwin *w) {
+    struct xwin_cursor *c = &w->w_cursor;
+    const struct xwin_tbuf *t = &w->w_tbuf;
+
+    c->c_ndamage = 0;
+    if (c->c_drawn) {
+        c->c_damage[c->c_ndamage++] = (struct xwin_damage) { c->c_y, c->c_x };
+    }
+    if (!c->c_drawn || c->c_x != t->t_cx || c->c_y != t->t_cy) {
+        c->c_damage[c->c_ndamage++] = (struct xwin_damage) { t->t_cy, t->t_cx };
+    }
+}
+
+struct s_xwin_strips {
+    struct xwin        *s_win;
+    const int          *s_rows;
+    struct xwin_raster  s_back;
+};
+
+// Renders one dirty row into its own strip of the backbuffer. Runs on the render workers
+// (and the main thread) with that thread's font context; strips never overlap.
+static void s_xwin_paint_strip(struct xwin_font_ctx *f, void *arg, int item) {
+    struct s_xwin_strips *s = arg;
+    int i = s->s_rows[item];
+    struct xwin_raster strip = s_xwin_clip(s->s_win, &s->s_back, i, 0, 0);
+
+    s_xwin_draw_cells(s->s_win, f, &strip, i, 0, s->s_win->w_tbuf.t_cols, 0);
+}
+
+static void s_xwin_paint(struct xwin *w) {
+    if (!w->w_width_chars || !w->w_height_chars || !w->w_graph.g_back) {
         return;
     }
 
     uint64_t t0, t1;
     const struct xwin_font_ctx *f = &w->w_font;
+    struct xwin_tbuf *t = &w->w_tbuf;
+    struct xwin_cursor *c = &w->w_cursor;
 
-    cairo_glyph_t *cairo_glyphs = cairo_glyph_allocate(w->w_width_chars);
-    if (!cairo_glyphs) {
+    int *rows = malloc(sizeof(int) * t->t_rows);
+    if (!rows) {
         return;
     }
-    cairo_save(cr);
-    cairo_set_font_face(cr, w->w_font.f_cairo_face);
-    cairo_set_font_size(cr, CT_FONT_SIZE);
+    int nrows = 0;
+
+    // All rendering writes straight into the backbuffer pixels
+    cairo_surface_flush(w->w_graph.g_back);
+    const struct xwin_raster back = {
+        .r_data = (uint32_t *) cairo_image_surface_get_data(w->w_graph.g_back),
+        .r_stride = cairo_image_surface_get_stride(w->w_graph.g_back) / sizeof(uint32_t),
+        .r_x0 = 0,
+        .r_y0 = 0,
+        .r_x1 = w->w_width,
+        .r_y1 = w->w_height,
+    };
+
+    // Damaged areas are collected as a path on the window context
+    cairo_t *out = cairo_create(w->w_graph.g_surface);
 
     t0 = s_millis();
-    for (int i = 0; i < w->w_tbuf.t_rows; ++i) {
-        if (!w->w_tbuf.t_lines[i]) {
+
+    // The cursor only costs two cells: the one it leaves and the one it enters
+    int show = c->c_on
+            && t->t_cx >= 0 && t->t_cy >= 0
+            && t->t_cx < t->t_cols && t->t_cy < t->t_rows;
+    int moved = c->c_x != t->t_cx || c->c_y != t->t_cy;
+
+    if (show != c->c_drawn || (show && (moved || t->t_dirty[t->t_cy]))) {
+        s_xwin_cursor_damage(w);
+    }
+
+    int redraw = c->c_ndamage;
+    for (int k = 0; k < c->c_ndamage; ++k) {
+        const struct xwin_damage *d = &c->c_damage[k];
+
+        if (d->d_row < 0 || d->d_col < 0 || d->d_row >= t->t_rows || d->d_col >= t->t_cols) {
             continue;
         }
+        int col = d->d_col;
+        int n = s_xwin_cell_span(w, d->d_row, &col);
 
-        if (w->w_tbuf.t_dirty[i]) {
-            for (int j = 0; j < w->w_tbuf.t_cols; ++j) {
-                int attr = w->w_tbuf.t_vis_attrs[i][j];
-                if (w->w_tbuf.t_cx == j && w->w_tbuf.t_cy == i) {
-                    int o = attr & 0xFF;
-                    attr &= ~0xFF;
-                    attr |= 0xFF - o;
-                }
-
-                cairo_set_source_rgb(cr, (attr & 0xFF) / 255.0, (attr & 0xFF) / 255.0, (attr & 0xFF) / 255.0);
-                cairo_rectangle(cr, CT_PAD_X + j * f->f_char_width, CT_PAD_Y + i * CT_FONT_SIZE, f->f_char_width, CT_FONT_SIZE);
-                cairo_fill(cr);
-            }
+        // Dirty rows are repainted whole below
+        if (!t->t_dirty[d->d_row]) {
+            s_xwin_paint_cell(w, &back, d->d_row, col, n, 0);
+        }
+        s_xwin_cell_rect(w, out, d->d_row, col, n);
+    }
+    c->c_ndamage = 0;
+    if (redraw) {
+        c->c_drawn = 0;
+    }
+
+    for (int i = 0; i < t->t_rows; ++i) {
+        if (!t->t_dirty[i]) {
+            continue;
+        }
+        t->t_dirty[i] = 0;
+
+        cairo_rectangle(out, 0, CT_PAD_Y + i * CT_FONT_SIZE, w->w_width, CT_FONT_SIZE);
+        if (t->t_lines[i]) {
+            rows[nrows++] = i;
+        } else {
+            // Emptied by a scroll
+            xwin_raster_fill(&back, 0, CT_PAD_Y + i * CT_FONT_SIZE, w->w_width, CT_FONT_SIZE, 0);
+        }
+    }
 
-            s_xwin_draw_text(w, cr, CT_PAD_X, CT_PAD_Y + i * CT_FONT_SIZE + CT_FONT_SIZE, i, cairo_glyphs);
-            w->w_tbuf.t_dirty[i] = 0;
+    struct s_xwin_strips strips = {
+        .s_win = w,
+        .s_rows = rows,
+        .s_back = back,
+    };
+
+    // Started on the first redraw big enough to use it, windows that never need it cost no threads
+    if (nrows >= CT_PARALLEL_ROWS && !w->w_pool_started) {
+        w->w_pool_started = 1;
+        if (xwin_pool_create(&w->w_pool, CT_WORKERS, w->w_font.f_char_width) != 0) {
+            fprintf(stderr, "Failed to start some render workers, running with %d\n", w->w_pool.p_count);
+        }
+    }
+
+    if (nrows >= CT_PARALLEL_ROWS && w->w_pool.p_count) {
+        xwin_pool_run(&w->w_pool, &w->w_font, s_xwin_paint_strip, &strips, nrows);
+    } else {
+        for (int k = 0; k < nrows; ++k) {
+            s_xwin_paint_strip(&w->w_font, &strips, k);
         }
     }
+
+    // Overlay, its cell is already part of the damage
+    if (show && redraw) {
+        c->c_x = t->t_cx;
+        c->c_y = t->t_cy;
+        s_xwin_paint_cursor(w, &back);
+        c->c_drawn = 1;
+    }
+
+    cairo_surface_mark_dirty(w->w_graph.g_back);
+
+    // Present
+    cairo_set_source_surface(out, w->w_graph.g_back, 0, 0);
+    cairo_fill(out);
     t1 = s_millis();
-    cairo_restore(cr);
-    cairo_glyph_free(cairo_glyphs);
-
-    if (w->w_tbuf.t_cx >= 0
-     && w->w_tbuf.t_cy >= 0
-     && w->w_tbuf.t_cx < w->w_tbuf.t_cols
-     && w->w_tbuf.t_cy < w->w_tbuf.t_rows
-     && (!w->w_tbuf.t_lines[w->w_tbuf.t_cy] ||
-         !w->w_tbuf.t_lines[w->w_tbuf.t_cy][w->w_tbuf.t_cx]
-         )) {
-        cairo_set_source_rgb(cr, 1, 1, 1);
-        cairo_rectangle(cr,
-                        CT_PAD_X + w->w_tbuf.t_cx * f->f_char_width,
-                        CT_PAD_Y + w->w_tbuf.t_cy * CT_FONT_SIZE,
-                        f->f_char_width,
-                        CT_FONT_SIZE);
-        cairo_fill(cr);
-    }
-
-    cairo_set_source_rgb(cr, 1, 0, 0);
-    cairo_rectangle(cr, 0, 0, w->w_tbuf.t_cols * f->f_char_width, w->w_tbuf.t_rows * CT_FONT_SIZE);
-    cairo_stroke(cr);
+
+    cairo_set_source_rgb(out, 1, 0, 0);
+    cairo_rectangle(out, 0, 0, t->t_cols * f->f_char_width, t->t_rows * CT_FONT_SIZE);
+    cairo_stroke(out);
+    cairo_destroy(out);
+
+    free(rows);
 
     printf("%d\n", t1 - t0);
 }
 
-void xwin_repaint(struct xwin *w) {
+// Copies an already rendered area of the backbuffer to the window
+void xwin_present(struct xwin *w, int x, int y, int width, int height) {
+    if (!w->w_visible || !w->w_graph.g_back) {
+        return;
+    }
+
     cairo_t *cr = cairo_create(w->w_graph.g_surface);
-    s_xwin_paint(w, cr);
-    xcb_flush(w->w_conn);
+    cairo_set_source_surface(cr, w->w_graph.g_back, 0, 0);
+    cairo_rectangle(cr, x, y, width, height);
+    cairo_fill(cr);
     cairo_destroy(cr);
 }
 
+void xwin_repaint(struct xwin *w) {
+    if (!w->w_visible) {
+        // Dirty rows accumulate in tbuf until the window is shown again
+        return;
+    }
+
+    s_xwin_paint(w);
+    xcb_flush(w->w_conn);
+}
+
+void xwin_cursor_style(struct xwin *w, int shape, int blink) {
+    w->w_cursor.c_shape = shape;
+    w->w_cursor.c_blink = blink;
+    xwin_cursor_reset(w);
+}
+
+void xwin_cursor_reset(struct xwin *w) {
+    w->w_cursor.c_on = 1;
+    w->w_cursor.c_next = s_millis() + w->w_cursor.c_blink;
+}
+
+void xwin_cursor_tick(struct xwin *w) {
+    struct xwin_cursor *c = &w->w_cursor;
+    uint64_t now;
+
+    // Only the focused, visible window blinks
+    if (!c->c_blink || !w->w_focused || !w->w_visible || (now = s_millis()) < c->c_next) {
+        return;
+    }
+
+    c->c_on = !c->c_on;
+    c->c_next = now + c->c_blink;
+    xwin_repaint(w);
+}
+
+void xwin_event_visibility(struct xwin *w) {
+    int visible = w->w_mapped && w->w_visibility != VisibilityFullyObscured;
+
+    if (visible == w->w_visible) {
+        return;
+    }
+
+    w->w_visible = visible;
+
+    if (visible) {
+        // Window contents were discarded while hidden
+        xwin_tbuf_dirty_all(&w->w_tbuf);
+        xwin_repaint(w);
+    }
+}
+
 void xwin_event_configure_notify(struct xwin *w, const XConfigureEvent *e) {
     int res = 0;
 
@@ -335,24 +667,59 @@ void xwin_event_configure_notify(struct xwin *w, const XConfigureEvent *e) {
 
     if (res) {
         cairo_xcb_surface_set_size(w->w_graph.g_surface, w->w_width, w->w_height);
+        cairo_surface_destroy(w->w_graph.g_back);
+        w->w_graph.g_back = cairo_image_surface_create(CAIRO_FORMAT_RGB24, w->w_width, w->w_height);
+        w->w_cursor.c_drawn = 0;
         xwin_tbuf_resize(&w->w_tbuf, w->w_height_chars, w->w_width_chars);
+        // The new backbuffer is blank
+        xwin_tbuf_dirty_all(&w->w_tbuf);
     }
 }
 
-static wchar_t s_utf8_to_wchar(const char *u) {
-    if (!u || !*u) {
-        return 0;
+// Decodes one UTF-8 sequence of at most n bytes and stores its length in *len.
+// Malformed input decodes to U+FFFD
+static wchar_t s_utf8_to_wchar(const char *s, int n, int *len) {
+    static const wchar_t s_min[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    const unsigned char *u = (const unsigned char *) s;
+    wchar_t c;
+    int l;
+
+    *len = 1;
+
+    if (u[0] < 0x80) {
+        return u[0];
+    } else if ((u[0] & 0xE0) == 0xC0) {
+        l = 2;
+        c = u[0] & 0x1F;
+    } else if ((u[0] & 0xF0) == 0xE0) {
+        l = 3;
+        c = u[0] & 0x0F;
+    } else if ((u[0] & 0xF8) == 0xF0) {
+        l = 4;
+        c = u[0] & 0x07;
+    } else {
+        return 0xFFFD;
     }
 
-    if (!(u[0] & ~0x7F)) {
-        return (wchar_t) u[0];
+    if (l > n) {
+        return 0xFFFD;
     }
 
-    if (u[0] < 224) {
-        return ((char) ((u[0] & ~0xE0)) << 6) | ((char) (u[1] & ~0xC0));
+    for (int i = 1; i < l; ++i) {
+        if ((u[i] & 0xC0) != 0x80) {
+            return 0xFFFD;
+        }
+        c = (c << 6) | (u[i] & 0x3F);
     }
 
-    return -1;
+    *len = l;
+
+    // Overlong forms, surrogates and values past U+10FFFF
+    if (c < s_min[l] || c > XU_MAX || (c >= 0xD800 && c <= 0xDFFF)) {
+        return 0xFFFD;
+    }
+
+    return c;
 }
 
 static void xwin_event_key_type(struct xwin *w, wchar_t sym) {
@@ -397,16 +764,47 @@ void xwin_event_key_press(struct xwin *w, XKeyPressedEvent *e) {
             return xwin_event_key_press_gen(w, keysym);
         }
 
-        wchar_t sym = s_utf8_to_wchar(buf);
-        xwin_event_key_type(w, sym);
+        // Input methods may commit several characters at once
+        for (int i = 0, len; i < count; i += len) {
+            wchar_t sym = s_utf8_to_wchar(buf + i, count - i, &len);
+            xwin_event_key_type(w, sym);
+        }
     } else {
         xwin_event_key_press_gen(w, keysym);
     }
 }
 
+// Milliseconds poll() may sleep for, -1 until an event arrives
+static int s_xwin_poll_timeout(struct xwin *w) {
+    const struct xwin_cursor *c = &w->w_cursor;
+
+    // Hidden and unfocused windows have nothing to animate
+    if (!w->w_visible || !w->w_focused || !c->c_blink) {
+        return -1;
+    }
+
+    uint64_t now = s_millis();
+    return c->c_next > now ? c->c_next - now : 0;
+}
+
+// Sleeps until the X connection becomes readable or the next cursor blink is due
+static void s_xwin_wait(struct xwin *w) {
+    struct pollfd fds[] = {
+        { .fd = ConnectionNumber(w->w_xdisplay), .events = POLLIN },
+        // TODO: add t_pty_master here once xwin_tbuf_poll() reads it
+    };
+
+    poll(fds, sizeof(fds) / sizeof(fds[0]), s_xwin_poll_timeout(w));
+}
+
 void xwin_poll_events(struct xwin *w) {
     XEvent event;
 
+    // XPending() also flushes requests queued by the last paint
+    if (!XPending(w->w_xdisplay)) {
+        s_xwin_wait(w);
+    }
+
     while (XPending(w->w_xdisplay)) {
         XNextEvent(w->w_xdisplay, &event);
 
@@ -418,11 +816,32 @@ void xwin_poll_events(struct xwin *w) {
             XRefreshKeyboardMapping(&event.xmapping);
             continue;
         }
-        if (event.type == UnmapNotify) {
+        if (event.type == DestroyNotify) {
             w->w_closed = 1;
             return;
         }
 
+        if (event.type == ClientMessage) {
+            if (event.xclient.message_type == w->w_wm_protocols
+             && (Atom) event.xclient.data.l[0] == w->w_wm_delete) {
+                w->w_closed = 1;
+                return;
+            }
+            continue;
+        }
+
+        if (event.type == MapNotify || event.type == UnmapNotify) {
+            w->w_mapped = event.type == MapNotify;
+            xwin_event_visibility(w);
+            continue;
+        }
+
+        if (event.type == VisibilityNotify) {
+            w->w_visibility = event.xvisibility.state;
+            xwin_event_visibility(w);
+            continue;
+        }
+
         if (event.type == ConfigureNotify) {
             xwin_event_configure_notify(w, (XConfigureEvent *) &event);
             continue;
@@ -435,22 +854,36 @@ void xwin_poll_events(struct xwin *w) {
                 continue;
             }
 
-            if (event.type == FocusIn) {
+            w->w_focused = event.type == FocusIn;
+
+            if (w->w_focused) {
                 XSetICFocus(w->w_input.i_xic);
+            } else {
+                XUnsetICFocus(w->w_input.i_xic);
             }
 
+            // Switch between the solid and the hollow cursor
+            xwin_cursor_reset(w);
+            s_xwin_cursor_damage(w);
+            xwin_repaint(w);
+
             continue;
         }
 
         if (event.type == Expose) {
+            XExposeEvent *e = (XExposeEvent *) &event;
+            xwin_present(w, e->x, e->y, e->width, e->height);
             xwin_repaint(w);
             continue;
         }
 
         if (event.type == KeyPress) {
             xwin_event_key_press(w, (XKeyPressedEvent *) &event);
+            xwin_cursor_reset(w);
             xwin_repaint(w);
             continue;
         }
     }
+
+    xwin_cursor_tick(w);
 }
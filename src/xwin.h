@@ -9,12 +9,48 @@
 #include <X11/Xlib.h>
 #include <wchar.h>
 #include <pty.h>
+#include <pthread.h>
 #include "wstr.h"
+#include "uwidth.h"
 
 #define CT_FONT_SIZE 16
 #define CT_PAD_X     2
 #define CT_PAD_Y     2
-#define CT_CURSOR    1
+#define CT_CURSOR_BLOCK     1
+#define CT_CURSOR_UNDERLINE 2
+#define CT_CURSOR_BAR       3
+#define CT_CURSOR    CT_CURSOR_BLOCK
+// Blink half-period in ms, 0 disables blinking
+#define CT_CURSOR_BLINK     500
+#define CT_CURSOR_THICKNESS 2
+// Render threads besides the main one, 0 uses one per other online CPU
+#define CT_WORKERS          0
+// Upper bound for CT_WORKERS 0, every worker holds its own FreeType face
+#define CT_MAX_WORKERS      16
+// Rendered glyph bitmaps kept per font context
+#define CT_GLYPH_CACHE      512
+// Fewer dirty rows than this are painted on the main thread
+#define CT_PARALLEL_ROWS    4
+// Combining marks kept per cell, extra ones are dropped
+#define CT_MAX_COMBINING 2
+// Right half of a double width character, never a valid code point
+#define CT_WIDE_CONT ((wchar_t) 0x110000)
+
+struct xwin_glyph {
+    unsigned int        g_id;
+    int                 g_valid;
+    int                 g_left, g_top;
+    int                 g_width, g_rows;
+    // 8-bit coverage, g_width bytes per row
+    unsigned char      *g_bits;
+};
+
+// Clip rectangle [r_x0, r_x1) x [r_y0, r_y1) over a 32-bit RGB pixel buffer
+struct xwin_raster {
+    uint32_t           *r_data;
+    int                 r_stride;
+    int                 r_x0, r_y0, r_x1, r_y1;
+};
 
 struct xwin_font_ctx {
     FT_Library          f_ft_library;
@@ -23,10 +59,13 @@ struct xwin_font_ctx {
     hb_buffer_t        *f_hb_buffer;
     cairo_font_face_t  *f_cairo_face;
     double              f_char_width;
+    struct xwin_glyph  *f_glyphs;
 };
 
 struct xwin_graph_ctx {
     cairo_surface_t    *g_surface;
+    // Rows are rendered here and then copied to g_surface
+    cairo_surface_t    *g_back;
     xcb_visualtype_t   *g_visualtype;
 };
 
@@ -35,9 +74,49 @@ struct xwin_input_ctx {
     XIC                 i_xic;
 };
 
+struct xwin_worker {
+    struct xwin_pool   *k_pool;
+    pthread_t           k_thread;
+    struct xwin_font_ctx k_font;
+};
+
+struct xwin_pool {
+    struct xwin_worker *p_workers;
+    int                 p_count;
+    pthread_mutex_t     p_lock;
+    pthread_cond_t      p_start, p_done;
+    // Workers still to be woken for the current job, and workers inside it
+    int                 p_slots;
+    int                 p_running;
+    int                 p_quit;
+    // Current job: p_fn is called once for every item in [0, p_items)
+    void              (*p_fn)(struct xwin_font_ctx *f, void *arg, int item);
+    void               *p_arg;
+    int                 p_items, p_next;
+};
+
+// Single cell damage rect, in cells
+struct xwin_damage {
+    int                 d_row, d_col;
+};
+
+struct xwin_cursor {
+    int                 c_shape;
+    int                 c_blink;
+    int                 c_on;
+    uint64_t            c_next;
+    // Cell the cursor was last drawn at
+    int                 c_drawn;
+    int                 c_x, c_y;
+    // Old and new cursor cells to repaint on the next paint
+    struct xwin_damage  c_damage[2];
+    int                 c_ndamage;
+};
+
 struct xwin_tbuf {
     wchar_t           **t_lines;
     int               **t_vis_attrs;
+    wchar_t          (**t_comb)[CT_MAX_COMBINING];
     int                *t_dirty;
     int                 t_rows, t_cols;
     int                 t_cx, t_cy;
@@ -54,17 +133,31 @@ struct xwin {
     const xcb_screen_t         *w_screen;
     int                         w_width, w_height;
     int                         w_closed;
+    int                         w_mapped, w_visibility, w_focused;
+    int                         w_visible;
+    Atom                        w_wm_protocols, w_wm_delete;
     int                         w_width_chars, w_height_chars;
     struct xwin_font_ctx        w_font;
     struct xwin_graph_ctx       w_graph;
     struct xwin_tbuf            w_tbuf;
     struct xwin_input_ctx       w_input;
+    struct xwin_cursor          w_cursor;
+    struct xwin_pool            w_pool;
+    int                         w_pool_started;
 };
 
 int xwin_font_ctx_create(struct xwin_font_ctx *f);
 void xwin_font_ctx_destroy(struct xwin_font_ctx *f);
 int xwin_font_ctx_load_glyph(struct xwin_font_ctx *f);
 
+const struct xwin_glyph *xwin_font_ctx_glyph(struct xwin_font_ctx *f, unsigned int gid);
+void xwin_raster_fill(const struct xwin_raster *r, int x, int y, int width, int height, int gray);
+void xwin_raster_glyph(const struct xwin_raster *r, const struct xwin_glyph *g, int x, int y, int gray);
+
+int xwin_pool_create(struct xwin_pool *p, int count, double char_width);
+void xwin_pool_destroy(struct xwin_pool *p);
+void xwin_pool_run(struct xwin_pool *p, struct xwin_font_ctx *f, void (*fn)(struct xwin_font_ctx *f, void *arg, int item), void *arg, int items);
+
 int xwin_tbuf_tty(struct xwin_tbuf *t);
 int xwin_tbuf_create(struct xwin_tbuf *t, int rows, int cols);
 int xwin_tbuf_resize(struct xwin_tbuf *t, int rows, int cols);
@@ -83,7 +176,13 @@ void xwin_destroy(struct xwin *w);
 void xwin_draw_text(struct xwin *w, cairo_t *cr, const wchar_t * text);
 void xwin_paint_region(struct xwin *w, int r0, int c0, int r1, int c1);
 void xwin_repaint(struct xwin *w);
+void xwin_present(struct xwin *w, int x, int y, int width, int height);
+
+void xwin_cursor_style(struct xwin *w, int shape, int blink);
+void xwin_cursor_reset(struct xwin *w);
+void xwin_cursor_tick(struct xwin *w);
 
 void xwin_poll_events(struct xwin *w);
+void xwin_event_visibility(struct xwin *w);
 void xwin_event_configure_notify(struct xwin *w, const XConfigureEvent *e);
 void xwin_event_key_press(struct xwin *w, XKeyPressedEvent *e);
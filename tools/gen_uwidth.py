@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Generates the two-stage character width/class table used by src/uwidth.h
+# from the Unicode database shipped with python (unicodedata).
+import sys
+import unicodedata
+
+SHIFT = 8
+BLOCK = 1 << SHIFT
+MAX_CP = 0x110000
+
+# Must match XU_CLASS_* in src/uwidth.h
+CLASS_CTRL      = 0
+CLASS_PRINT     = 1
+CLASS_WIDE      = 2
+CLASS_COMBINING = 3
+CLASS_ZERO      = 4
+CLASS_INVALID   = 5
+
+# Unassigned ranges UAX #11 defaults to East Asian Wide
+CJK_RESERVED = (
+    (0x3400, 0x4DBF),
+    (0x4E00, 0x9FFF),
+    (0xF900, 0xFAFF),
+    (0x20000, 0x2FFFD),
+    (0x30000, 0x3FFFD),
+)
+
+
+def prop(cp):
+    if 0xD800 <= cp <= 0xDFFF:
+        return CLASS_INVALID, 1
+
+    ch = chr(cp)
+    cat = unicodedata.category(ch)
+
+    if cat == 'Cc':
+        return CLASS_CTRL, 0
+    if cat in ('Mn', 'Me'):
+        return CLASS_COMBINING, 0
+    # Hangul medial vowels and final consonants combine with the leading jamo
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return CLASS_COMBINING, 0
+    if cat == 'Cf' and cp != 0x00AD:
+        return CLASS_ZERO, 0
+    if cat in ('Zl', 'Zp'):
+        return CLASS_ZERO, 0
+
+    # unicodedata reports every unassigned code point as 'F', so use the
+    # UAX #11 defaults instead: only the reserved CJK ranges are wide
+    if cat == 'Cn':
+        if (cp & 0xFFFE) == 0xFFFE or 0xFDD0 <= cp <= 0xFDEF:
+            return CLASS_INVALID, 1
+        if any(lo <= cp <= hi for lo, hi in CJK_RESERVED):
+            return CLASS_WIDE, 2
+        return CLASS_PRINT, 1
+
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return CLASS_WIDE, 2
+
+    return CLASS_PRINT, 1
+
+
+def main():
+    blocks = []
+    block_index = {}
+    stage1 = []
+
+    for base in range(0, MAX_CP, BLOCK):
+        block = tuple((c << 2) | w for c, w in map(prop, range(base, base + BLOCK)))
+        if block not in block_index:
+            block_index[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(block_index[block])
+
+    out = sys.stdout
+    out.write('/* Generated by tools/gen_uwidth.py from Unicode %s, do not edit */\n'
+              % unicodedata.unidata_version)
+    out.write('#include "uwidth.h"\n\n')
+
+    out.write('const uint16_t xu_stage1[%d] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write('    ' + ', '.join('%d' % v for v in stage1[i:i + 16]) + ',\n')
+    out.write('};\n\n')
+
+    out.write('const uint8_t xu_stage2[%d] = {\n' % (len(blocks) * BLOCK))
+    for block in blocks:
+        for i in range(0, BLOCK, 16):
+            out.write('    ' + ', '.join('0x%02x' % v for v in block[i:i + 16]) + ',\n')
+    out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()